@@ -0,0 +1,344 @@
+#ifndef RAY_TRACING_CACHE
+#define RAY_TRACING_CACHE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include "camera.h"
+#include "ray_tracing_math.h"
+#include "scene.h"
+
+// NOTE(fede): On-disk cache of finished renders. Two kinds of entries live
+//  in the cache directory:
+//
+//   <key>.ppm  finished image, key covers scene, camera and every render setting
+//   <key>.acc  float accumulation of the first N samples, key leaves out the
+//              samples per pixel so a render asking for more samples can
+//              continue from it instead of starting over
+//
+//  Bump RENDER_CACHE_VERSION whenever the image for the same inputs changes.
+
+#define RENDER_CACHE_VERSION 5
+#define RENDER_CACHE_MAGIC 0x31434152u    // NOTE(fede): "RAC1"
+
+struct render_cache {
+    const char *directory;
+    uint64_t max_bytes;
+    int image_hits;
+    int accumulation_hits;
+    int misses;
+    int stores;
+    int evictions;
+    uint64_t bytes_in_use;
+};
+
+struct accumulation_header {
+    uint32_t magic;
+    int image_width;
+    int image_height;
+    int samples_per_pixel;
+};
+
+inline uint64_t hash_bytes(uint64_t h, const void* data, size_t size) {
+    // NOTE(fede): FNV-1a
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint64_t hash_scene(uint64_t h, scene* s) {
+    h = hash_bytes(h, &s->sphere_count, sizeof(s->sphere_count));
+    h = hash_bytes(h, s->spheres, s->sphere_count * sizeof(sphere));
+    h = hash_bytes(h, &s->material_count, sizeof(s->material_count));
+    for (size_t i = 0; i < s->material_count; ++i) {
+        // NOTE(fede): Field by field, material.scattered is scratch space
+        material *mat = &s->materials[i];
+        h = hash_bytes(h, &mat->type, sizeof(mat->type));
+        h = hash_bytes(h, &mat->attenuation, sizeof(mat->attenuation));
+        h = hash_bytes(h, &mat->albedo, sizeof(mat->albedo));
+        h = hash_bytes(h, &mat->fuzz, sizeof(mat->fuzz));
+        h = hash_bytes(h, &mat->refraction_index, sizeof(mat->refraction_index));
+    }
+    return h;
+}
+
+// NOTE(fede): Key shared by every samples per pixel count of the same render
+uint64_t accumulation_key(scene* s, camera* c, int image_width, int image_height, int max_depth, uint32_t seed) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    int version = RENDER_CACHE_VERSION;
+    h = hash_bytes(h, &version, sizeof(version));
+    h = hash_scene(h, s);
+    h = hash_bytes(h, c, sizeof(camera));
+    h = hash_bytes(h, &image_width, sizeof(image_width));
+    h = hash_bytes(h, &image_height, sizeof(image_height));
+    h = hash_bytes(h, &max_depth, sizeof(max_depth));
+    h = hash_bytes(h, &seed, sizeof(seed));
+    return h;
+}
+
+inline uint64_t image_key(uint64_t accumulation_key, int samples_per_pixel) {
+    return hash_bytes(accumulation_key, &samples_per_pixel, sizeof(samples_per_pixel));
+}
+
+inline void cache_path(render_cache* cache, uint64_t key, const char* extension, char* path, size_t path_size) {
+    snprintf(path, path_size, "%s/%016llx.%s", cache->directory, (unsigned long long) key, extension);
+}
+
+bool copy_file(const char* from, const char* to) {
+    FILE *in = fopen(from, "rb");
+    if (!in) {
+        return false;
+    }
+    FILE *out = fopen(to, "wb");
+    if (!out) {
+        perror(to);
+        fclose(in);
+        return false;
+    }
+
+    bool ok = true;
+    char buffer[1 << 16];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, read, out) != read) {
+            ok = false;
+            break;
+        }
+    }
+    ok = !ferror(in) && ok;
+    fclose(in);
+    ok = (fclose(out) == 0) && ok;
+
+    return ok;
+}
+
+// NOTE(fede): Copies through a temporary file and a rename, so a crash or a
+//  full disk never leaves a truncated entry behind
+bool copy_file_atomically(const char* from, const char* to) {
+    char temporary_path[520];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", to);
+    if (copy_file(from, temporary_path) && rename(temporary_path, to) == 0) {
+        return true;
+    }
+
+    remove(temporary_path);
+    return false;
+}
+
+// NOTE(fede): True when path is a complete P6 image of the given size
+bool is_complete_ppm(const char* path, int image_width, int image_height) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    int width = 0;
+    int height = 0;
+    int max_value = 0;
+    bool ok = fscanf(file, "P6 %d %d %d", &width, &height, &max_value) == 3 &&
+              width == image_width && height == image_height && max_value == 255 &&
+              fgetc(file) != EOF;
+    if (ok) {
+        long pixels_offset = ftell(file);
+        ok = fseek(file, 0, SEEK_END) == 0 &&
+             ftell(file) == pixels_offset + (long) image_width * image_height * 3;
+    }
+    fclose(file);
+
+    return ok;
+}
+
+bool open_render_cache(render_cache* cache, const char* directory, uint64_t max_bytes) {
+    *cache = {};
+    cache->directory = directory;
+    cache->max_bytes = max_bytes;
+    if (mkdir(directory, 0755) != 0) {
+        struct stat info;
+        if (stat(directory, &info) != 0 || !S_ISDIR(info.st_mode)) {
+            perror(directory);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// NOTE(fede): Returns true when the finished image was copied to output_path
+bool cache_lookup_image(render_cache* cache, uint64_t key, int image_width, int image_height, const char* output_path) {
+    char path[512];
+    cache_path(cache, key, "ppm", path, sizeof(path));
+    if (is_complete_ppm(path, image_width, image_height) && copy_file(path, output_path)) {
+        // NOTE(fede): Touch the entry so eviction sees it as recently used
+        utime(path, NULL);
+        cache->image_hits++;
+        return true;
+    }
+
+    return false;
+}
+
+// NOTE(fede): Loads the accumulation into accumulation when it holds at most
+//  the samples requested. Returns the number of samples loaded, when it is
+//  all of them only the conversion to pixels is left (the image was evicted).
+int cache_lookup_accumulation(render_cache* cache, uint64_t key, int image_width, int image_height,
+                              int samples_per_pixel, float* accumulation) {
+    char path[512];
+    cache_path(cache, key, "acc", path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        cache->misses++;
+        return 0;
+    }
+
+    int samples_loaded = 0;
+    accumulation_header header = {};
+    size_t value_count = (size_t) image_width * image_height * 3;
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == RENDER_CACHE_MAGIC &&
+        header.image_width == image_width &&
+        header.image_height == image_height &&
+        header.samples_per_pixel > 0 &&
+        header.samples_per_pixel <= samples_per_pixel &&
+        fread(accumulation, sizeof(float), value_count, file) == value_count) {
+        samples_loaded = header.samples_per_pixel;
+    }
+    fclose(file);
+
+    if (samples_loaded > 0) {
+        utime(path, NULL);
+        cache->accumulation_hits++;
+    } else {
+        memset(accumulation, 0, value_count * sizeof(float));
+        cache->misses++;
+    }
+
+    return samples_loaded;
+}
+
+void cache_store(render_cache* cache, uint64_t key, int image_width, int image_height, int samples_per_pixel,
+                 float* accumulation, const char* image_path) {
+    char path[512];
+    cache_path(cache, image_key(key, samples_per_pixel), "ppm", path, sizeof(path));
+    bool stored = copy_file_atomically(image_path, path);
+
+    // NOTE(fede): Keep whichever accumulation has more samples
+    cache_path(cache, key, "acc", path, sizeof(path));
+    accumulation_header header = {};
+    FILE *file = fopen(path, "rb");
+    if (file) {
+        if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != RENDER_CACHE_MAGIC) {
+            header.samples_per_pixel = 0;
+        }
+        fclose(file);
+    }
+
+    if (header.samples_per_pixel < samples_per_pixel) {
+        // NOTE(fede): Write to a temporary file and rename so a crash never
+        //  leaves a truncated accumulation behind
+        char temporary_path[520];
+        snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+        file = fopen(temporary_path, "wb");
+        if (file) {
+            header.magic = RENDER_CACHE_MAGIC;
+            header.image_width = image_width;
+            header.image_height = image_height;
+            header.samples_per_pixel = samples_per_pixel;
+            size_t value_count = (size_t) image_width * image_height * 3;
+            bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                           fwrite(accumulation, sizeof(float), value_count, file) == value_count;
+            written = (fclose(file) == 0) && written;
+            if (written && rename(temporary_path, path) == 0) {
+                stored = true;
+            } else {
+                remove(temporary_path);
+            }
+        }
+    }
+
+    if (stored) {
+        cache->stores++;
+    }
+}
+
+struct cache_entry {
+    char name[256];
+    double last_used;
+    uint64_t size;
+};
+
+int compare_cache_entries(const void* a, const void* b) {
+    double last_used_a = ((cache_entry *) a)->last_used;
+    double last_used_b = ((cache_entry *) b)->last_used;
+    return (last_used_a > last_used_b) - (last_used_a < last_used_b);
+}
+
+// NOTE(fede): Removes the least recently used entries until the cache fits max_bytes
+void cache_evict(render_cache* cache) {
+    DIR *directory = opendir(cache->directory);
+    if (!directory) {
+        perror(cache->directory);
+        return;
+    }
+
+    int entry_capacity = 64;
+    int entry_count = 0;
+    cache_entry *entries = (cache_entry *) malloc(entry_capacity * sizeof(cache_entry));
+    cache->bytes_in_use = 0;
+    char path[512];
+    dirent *dir_entry;
+    while ((dir_entry = readdir(directory)) != NULL) {
+        const char *extension = strrchr(dir_entry->d_name, '.');
+        if (!extension || (strcmp(extension, ".ppm") != 0 && strcmp(extension, ".acc") != 0)) {
+            continue;
+        }
+
+        struct stat info;
+        snprintf(path, sizeof(path), "%s/%s", cache->directory, dir_entry->d_name);
+        if (stat(path, &info) != 0) {
+            continue;
+        }
+
+        if (entry_count == entry_capacity) {
+            entry_capacity *= 2;
+            entries = (cache_entry *) realloc(entries, entry_capacity * sizeof(cache_entry));
+        }
+        cache_entry *entry = &entries[entry_count++];
+        snprintf(entry->name, sizeof(entry->name), "%s", dir_entry->d_name);
+        entry->last_used = info.st_mtim.tv_sec + info.st_mtim.tv_nsec * 1e-9;
+        entry->size = info.st_size;
+        cache->bytes_in_use += info.st_size;
+    }
+    closedir(directory);
+
+    qsort(entries, entry_count, sizeof(cache_entry), compare_cache_entries);
+    for (int i = 0; i < entry_count && cache->bytes_in_use > cache->max_bytes; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", cache->directory, entries[i].name);
+        if (remove(path) == 0) {
+            cache->bytes_in_use -= entries[i].size;
+            cache->evictions++;
+        }
+    }
+
+    free(entries);
+}
+
+void print_cache_stats(render_cache* cache) {
+    printf("Cache %s: %d image hits, %d partial hits, %d misses, %d stores, %d evictions, %.1f of %.1f MB in use\n\n",
+           cache->directory,
+           cache->image_hits,
+           cache->accumulation_hits,
+           cache->misses,
+           cache->stores,
+           cache->evictions,
+           cache->bytes_in_use / (1024.0 * 1024.0),
+           cache->max_bytes / (1024.0 * 1024.0));
+}
+
+#endif
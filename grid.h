@@ -0,0 +1,307 @@
+#ifndef RAY_TRACING_GRID
+#define RAY_TRACING_GRID
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "hit.h"
+#include "ray_tracing_math.h"
+#include "ray.h"
+#include "scene.h"
+
+// NOTE(fede): Uniform grid accelerator traversed with 3D-DDA (Amanatides & Woo).
+//  Spheres much bigger than the typical one (like the ground sphere) would be
+//  referenced by most cells, so they are kept apart and tested linearly.
+//  When spheres move, the shutter interval is split in GRID_TIME_BUCKETS
+//  equal buckets, each one with its own cell lists where moving spheres
+//  are placed in the cells they sweep during that bucket only. A ray walks
+//  the lists of the bucket holding its time, so it does not test spheres
+//  that are somewhere else at that instant. Grid bounds and large spheres
+//  use the bounds swept over the whole shutter.
+
+#define GRID_DENSITY 2.0f               // NOTE(fede): Target cell count per small sphere
+#define GRID_LARGE_RADIUS_FACTOR 16.0f  // NOTE(fede): Radius over median radius that makes a sphere _large_
+#define GRID_MAX_RESOLUTION 1024        // NOTE(fede): Max cells per axis
+#define GRID_TIME_BUCKETS 4             // NOTE(fede): Shutter subdivisions when any sphere moves, a power
+                                        //  of two keeps the bucket edges exact in float
+
+struct grid {
+    v3 bounds_min;
+    v3 bounds_max;
+    v3 cell_size;
+    int resolution[3];
+    int cell_count;
+    int time_buckets;       // NOTE(fede): 1 when no sphere moves
+    int *cell_offsets;      // NOTE(fede): time_buckets * cell_count + 1 entries, items of cell i in bucket b are
+                            //  [cell_offsets[b * cell_count + i], cell_offsets[b * cell_count + i + 1])
+    int *cell_items;        // NOTE(fede): sphere indices referenced by each cell
+    int *large_items;       // NOTE(fede): sphere indices tested on every ray
+    int large_count;
+};
+
+inline int clampi(int n, int min, int max) {
+    if (n < min) {
+        return min;
+    } else if (n > max) {
+        return max;
+    } else {
+        return n;
+    }
+}
+
+inline int grid_cell_index(grid* g, int x, int y, int z) {
+    return x + g->resolution[0] * (y + g->resolution[1] * z);
+}
+
+// NOTE(fede): Radius of a sphere enclosing the swept volume, used to tell large spheres apart
+inline float bounding_radius(sphere* s) {
+    return s->radius + 0.5f * length(s->motion);
+}
+
+// NOTE(fede): Cells the sphere overlaps during time bucket bucket
+inline void grid_cell_range(grid* g, sphere* s, int bucket, int* cell_min, int* cell_max) {
+    v3 lo, hi;
+    sphere_bounds(s, (float) bucket / g->time_buckets, (float) (bucket + 1) / g->time_buckets, &lo, &hi);
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo_cell = (lo.e[axis] - g->bounds_min.e[axis]) / g->cell_size.e[axis];
+        float hi_cell = (hi.e[axis] - g->bounds_min.e[axis]) / g->cell_size.e[axis];
+        cell_min[axis] = clampi((int) lo_cell, 0, g->resolution[axis] - 1);
+        cell_max[axis] = clampi((int) hi_cell, 0, g->resolution[axis] - 1);
+    }
+}
+
+grid *build_grid(scene* s) {
+    grid *g = (grid *) calloc(1, sizeof(grid));
+    int sphere_count = (int) s->sphere_count;
+
+    // NOTE(fede): Split spheres by comparing against the median radius,
+    //  nth_element keeps the build O(N)
+    float median_radius = 0.0;
+    if (sphere_count > 0) {
+        float *radii = (float *) malloc(sphere_count * sizeof(float));
+        for (int i = 0; i < sphere_count; ++i) {
+            radii[i] = bounding_radius(&s->spheres[i]);
+        }
+        std::nth_element(radii, radii + sphere_count / 2, radii + sphere_count);
+        median_radius = radii[sphere_count / 2];
+        free(radii);
+    }
+    float large_radius = GRID_LARGE_RADIUS_FACTOR * median_radius;
+
+    bool *is_large = (bool *) malloc(sphere_count * sizeof(bool) + 1);
+    int small_count = 0;
+    g->time_buckets = 1;
+    g->bounds_min = V3(FLT_MAX, FLT_MAX, FLT_MAX);
+    g->bounds_max = V3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < sphere_count; ++i) {
+        sphere *sp = &s->spheres[i];
+        is_large[i] = bounding_radius(sp) > large_radius;
+        if (is_large[i]) {
+            g->large_count++;
+            continue;
+        }
+        small_count++;
+        if (sp->motion.x != 0 || sp->motion.y != 0 || sp->motion.z != 0) {
+            g->time_buckets = GRID_TIME_BUCKETS;
+        }
+        v3 lo, hi;
+        sphere_bounds(sp, 0.0, 1.0, &lo, &hi);
+        for (int axis = 0; axis < 3; ++axis) {
+            g->bounds_min.e[axis] = min(g->bounds_min.e[axis], lo.e[axis]);
+            g->bounds_max.e[axis] = max(g->bounds_max.e[axis], hi.e[axis]);
+        }
+    }
+
+    g->large_items = (int *) malloc(g->large_count * sizeof(int) + 1);
+    for (int i = 0, large_index = 0; i < sphere_count; ++i) {
+        if (is_large[i]) {
+            g->large_items[large_index++] = i;
+        }
+    }
+
+    if (small_count == 0) {
+        g->bounds_min = V3(0.0, 0.0, 0.0);
+        g->bounds_max = V3(0.0, 0.0, 0.0);
+    }
+
+    // NOTE(fede): Pick cells so that the grid holds about GRID_DENSITY cells per
+    //  sphere, thin axes (like a layer of spheres over a plane) end up with few cells
+    v3 extent = g->bounds_max - g->bounds_min;
+    for (int axis = 0; axis < 3; ++axis) {
+        extent.e[axis] = max(extent.e[axis], 1e-4);
+    }
+    float volume = extent.x * extent.y * extent.z;
+    float cells_per_unit = cbrtf((GRID_DENSITY * small_count) / volume);
+    g->cell_count = 1;
+    for (int axis = 0; axis < 3; ++axis) {
+        g->resolution[axis] = clampi((int) ceilf(extent.e[axis] * cells_per_unit), 1, GRID_MAX_RESOLUTION);
+        g->cell_size.e[axis] = extent.e[axis] / g->resolution[axis];
+        g->cell_count *= g->resolution[axis];
+    }
+
+    // NOTE(fede): Counting pass, prefix sum, then filling pass. The buckets
+    //  are laid out one after the other, so one prefix sum covers them all
+    int list_count = g->time_buckets * g->cell_count;
+    g->cell_offsets = (int *) calloc(list_count + 1, sizeof(int));
+    int cell_min[3];
+    int cell_max[3];
+    for (int bucket = 0; bucket < g->time_buckets; ++bucket) {
+        int *bucket_offsets = g->cell_offsets + bucket * g->cell_count;
+        for (int i = 0; i < sphere_count; ++i) {
+            if (is_large[i]) {
+                continue;
+            }
+            grid_cell_range(g, &s->spheres[i], bucket, cell_min, cell_max);
+            for (int z = cell_min[2]; z <= cell_max[2]; ++z) {
+                for (int y = cell_min[1]; y <= cell_max[1]; ++y) {
+                    for (int x = cell_min[0]; x <= cell_max[0]; ++x) {
+                        bucket_offsets[grid_cell_index(g, x, y, z) + 1]++;
+                    }
+                }
+            }
+        }
+    }
+    for (int list = 0; list < list_count; ++list) {
+        g->cell_offsets[list + 1] += g->cell_offsets[list];
+    }
+
+    int item_count = g->cell_offsets[list_count];
+    g->cell_items = (int *) malloc(item_count * sizeof(int) + 1);
+    int *cursor = (int *) malloc(list_count * sizeof(int));
+    memcpy(cursor, g->cell_offsets, list_count * sizeof(int));
+    for (int bucket = 0; bucket < g->time_buckets; ++bucket) {
+        int *bucket_cursor = cursor + bucket * g->cell_count;
+        for (int i = 0; i < sphere_count; ++i) {
+            if (is_large[i]) {
+                continue;
+            }
+            grid_cell_range(g, &s->spheres[i], bucket, cell_min, cell_max);
+            for (int z = cell_min[2]; z <= cell_max[2]; ++z) {
+                for (int y = cell_min[1]; y <= cell_max[1]; ++y) {
+                    for (int x = cell_min[0]; x <= cell_max[0]; ++x) {
+                        g->cell_items[bucket_cursor[grid_cell_index(g, x, y, z)]++] = i;
+                    }
+                }
+            }
+        }
+    }
+
+    free(cursor);
+    free(is_large);
+
+    return g;
+}
+
+void free_grid(grid* g) {
+    if (g) {
+        free(g->cell_offsets);
+        free(g->cell_items);
+        free(g->large_items);
+        free(g);
+    }
+}
+
+hit_information hit_scene_grid(ray* r, float t_min, float t_max, scene* s) {
+    grid *g = s->spatial_grid;
+    hit_information closest = {};
+    closest.t = t_max;
+
+    for (int i = 0; i < g->large_count; ++i) {
+        hit_information h = hit_sphere(r, t_min, closest.t, s, g->large_items[i]);
+        if (h.hit_object) {
+            closest = h;
+        }
+    }
+
+    // NOTE(fede): Clip the ray against the grid bounds (slab test)
+    float t_enter = t_min;
+    float t_exit = closest.t;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (r->direction.e[axis] == 0) {
+            // NOTE(fede): Parallel to the slab, (bound - origin) * inf would be NaN
+            //  for an origin right on a bound, so only check the origin is inside
+            if (r->origin.e[axis] < g->bounds_min.e[axis] || r->origin.e[axis] > g->bounds_max.e[axis]) {
+                return closest;
+            }
+            continue;
+        }
+        float inverse_direction = 1.0f / r->direction.e[axis];
+        float t0 = (g->bounds_min.e[axis] - r->origin.e[axis]) * inverse_direction;
+        float t1 = (g->bounds_max.e[axis] - r->origin.e[axis]) * inverse_direction;
+        if (t0 > t1) {
+            float temp = t0;
+            t0 = t1;
+            t1 = temp;
+        }
+        t_enter = max(t_enter, t0);
+        t_exit = min(t_exit, t1);
+    }
+    if (t_enter > t_exit) {
+        return closest;
+    }
+
+    // NOTE(fede): 3D-DDA setup, t_next is the ray parameter where the ray
+    //  crosses the next cell boundary on each axis
+    v3 entry = ray_at(r, t_enter);
+    int cell[3];
+    int step[3];
+    float t_next[3];
+    float t_delta[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        float d = r->direction.e[axis];
+        float relative_entry = (entry.e[axis] - g->bounds_min.e[axis]) / g->cell_size.e[axis];
+        cell[axis] = clampi((int) relative_entry, 0, g->resolution[axis] - 1);
+        if (d > 0) {
+            step[axis] = 1;
+            t_next[axis] = (g->bounds_min.e[axis] + (cell[axis] + 1) * g->cell_size.e[axis] - r->origin.e[axis]) / d;
+            t_delta[axis] = g->cell_size.e[axis] / d;
+        } else if (d < 0) {
+            step[axis] = -1;
+            t_next[axis] = (g->bounds_min.e[axis] + cell[axis] * g->cell_size.e[axis] - r->origin.e[axis]) / d;
+            t_delta[axis] = -g->cell_size.e[axis] / d;
+        } else {
+            step[axis] = 0;
+            t_next[axis] = FLT_MAX;
+            t_delta[axis] = FLT_MAX;
+        }
+    }
+
+    // NOTE(fede): Ray times are in [0, 1), the clamp only guards the last bucket
+    int bucket = clampi((int) (r->time * g->time_buckets), 0, g->time_buckets - 1);
+    int *bucket_offsets = g->cell_offsets + bucket * g->cell_count;
+    while (true) {
+        int cell_index = grid_cell_index(g, cell[0], cell[1], cell[2]);
+        for (int item = bucket_offsets[cell_index]; item < bucket_offsets[cell_index + 1]; ++item) {
+            hit_information h = hit_sphere(r, t_min, closest.t, s, g->cell_items[item]);
+            if (h.hit_object) {
+                closest = h;
+            }
+        }
+
+        int axis = 0;
+        if (t_next[1] < t_next[axis]) {
+            axis = 1;
+        }
+        if (t_next[2] < t_next[axis]) {
+            axis = 2;
+        }
+
+        // NOTE(fede): A sphere can span several cells, so a hit only ends the
+        //  traversal once it lies before the exit of the current cell
+        if (closest.t <= t_next[axis]) {
+            break;
+        }
+
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= g->resolution[axis]) {
+            break;
+        }
+        t_next[axis] += t_delta[axis];
+    }
+
+    return closest;
+}
+
+#endif
@@ -1,120 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <float.h>
 #include <time.h>
 
 #include "camera.h"
+#include "grid.h"
 #include "hit.h"
 #include "ray_tracing_math.h"
 #include "ray.h"
+#include "regression.h"
+#include "render.h"
 #include "scene.h"
+#include "scene_file.h"
 
-inline bool surrounds(float min, float max, float n) {
-    return min < n && n < max;
-}
-
-hit_information ray_color(ray* r, float t_min, float t_max, scene* scene_object, int object_index) {
-    sphere s = scene_object->spheres[object_index];
-    v3 cq = s.center - r->origin;
-    float a = dot(r->direction, r->direction);
-    float b = dot(-2 * r->direction, cq);
-    float c = dot(cq, cq) - (s.radius * s.radius);
-    // NOTE(fede): Lets evaluate the quadratic equation's
-    //  discriminant to see if our ray has hit the sphere
-    float discriminant = (b * b) - 4 * a * c;
-
-    if (discriminant >= 0) {
-        float t0 = (-b - sqrtf(discriminant)) / (2 * a);
-
-        if (!surrounds(t_min, t_max, t0)) {
-            t0 = (-b + sqrtf(discriminant)) / (2 * a);
-            if (!surrounds(t_min, t_max, t0)) {
-                hit_information result = {};
-                result.hit_object = false;
-
-                return result;
-            }
-        }
-        v3 p = ray_at(r, t0);
-        v3 outward_normal = normalize(p - s.center);
-        bool is_front_face = dot(r->direction, outward_normal) < 0;
-
-        hit_information result = {};
-        result.t = t0;
-        result.p = p;
-        result.normal = is_front_face ? outward_normal : -outward_normal;
-        result.hit_object = true;
-        result.is_front_face = is_front_face;
-        result.object_index = object_index;
-
-        return result;
-    }
-
-    hit_information result = {V3(1, 0, 1), FLT_MAX, false};
-    return result;
-}
-
-v3 ray_color(ray* r, int max_depth, float t_min, float t_max, scene* s) {
-    if (max_depth <= 0) {
-        return V3(0.0, 0.0, 0.0);
-    }
-
-    hit_information closest = {};
-    closest.t = FLT_MAX;
-    for (int i = 0; i < s->sphere_count; ++i) {
-        hit_information h = ray_color(r, t_min, t_max, s, i);
-        if (h.hit_object && h.t <= closest.t) {
-            closest = h;
-        }
-    }
-
-    if (!closest.hit_object) {
-        // NOTE(fede): If no objects hit by ray just render
-        //  the _blue_sky_ background for this ray
-        v3 unit_direction = normalize(r->direction);
-        v3 white_color = V3(1.0, 1.0, 1.0);
-        v3 blue_sky_color = V3(0.5, 0.7, 1.0);
-        float t = 0.5 * (unit_direction.y + 1.0);
-
-        return lerp(white_color, t, blue_sky_color);
-    }
-
-    material mat = scatter(r, s, &closest);
-    return hadamard(mat.attenuation, ray_color(&mat.scattered, max_depth - 1, 0.001, FLT_MAX, s));
-}
-
-inline float linear_to_gamma(float linear_component) {
-    if (linear_component > 0) {
-        return sqrtf(linear_component);
-    }
-
-    return 0;
-}
+#define RANDOM_SCENE_SEED 0x5ce9e
+#define BOUNCING_MOTION_SEED 0xb0c1
 
-int main() {
-    time_t start_time = time(0);
-    float aspect_ratio = 16.0 / 9.0;
-    int image_width = 1200;
-    int image_height = (int) image_width / aspect_ratio;
-    image_height = image_height < 1 ? 1 : image_height;
-
-    v3 camera_position        = V3(13.0, 2.0, 3.0);
-    v3 camera_look_at         = V3(0.0, 0.0, 0.0);
-    v3 camera_vup             = V3(0.0, 1.0, 0.0);
-    float camera_vfov_degrees = 20.0;
-    float focus_distance = 10.0;
-    float defocus_angle_degrees = 0.6;
-    camera c = Camera(
-        image_width,
-        image_height,
-        camera_position,
-        camera_look_at,
-        camera_vup,
-        camera_vfov_degrees,
-        focus_distance,
-        defocus_angle_degrees
-    );
+// NOTE(fede): Ground sphere, sphere_count - 1 small spheres scattered over
+//  [-extent, extent] on the ground plane and the three big spheres
+scene random_scene(int sphere_count, float extent) {
+    // NOTE(fede): Fixed seed so the scene does not depend on whatever drew
+    //  random numbers before (like an earlier scene of the same batch)
+    seed_random(RANDOM_SCENE_SEED);
 
     material material_ground = {
         .type = Lambertian,
@@ -190,15 +99,15 @@ int main() {
         .material_index = 7
     };
 
-    sphere spheres[103] = {
-        { V3( 0.0, -1000.0, 0.0), 1000.0, 0}
-    };
+    sphere *spheres = (sphere *) malloc((sphere_count + 3) * sizeof(sphere));
+    sphere ground = { V3( 0.0, -1000.0, 0.0), 1000.0, 0};
+    spheres[0] = ground;
 
     int index = 1;
-    while (index < 100) {
+    while (index < sphere_count) {
         float choose_material = randf();
         
-        v3 center = V3(randf(-11, 11) + 0.9 * randf(), 0.2, randf(-11, 11) + 0.9 * randf());
+        v3 center = V3(randf(-extent, extent) + 0.9 * randf(), 0.2, randf(-extent, extent) + 0.9 * randf());
         if (length(center - V3(4.0, 0.2, 0.0)) > 0.9) {
             if (choose_material < 0.6) {
                 // NOTE(fede): Diffuse material
@@ -228,11 +137,11 @@ int main() {
             index++;
         }
     }
-    spheres[100] = s1;
-    spheres[101] = s2;
-    spheres[102] = s3;
+    spheres[sphere_count + 0] = s1;
+    spheres[sphere_count + 1] = s2;
+    spheres[sphere_count + 2] = s3;
 
-    material materials[8] = {
+    material scene_materials[8] = {
         material_ground,
         material_center,
         material_left_glass,
@@ -243,63 +152,586 @@ int main() {
         material_metal_big
     };
 
-    scene s = { spheres, 103, materials, 8 };
-    int samples_per_pixel = 100;
-    float pixel_samples_scale = 1.0 / samples_per_pixel;
-    int max_depth = 50;
+    material *materials = (material *) malloc(sizeof(scene_materials));
+    memcpy(materials, scene_materials, sizeof(scene_materials));
+
+    scene result = { spheres, (size_t) sphere_count + 3, materials, 8 };
+    return result;
+}
+
+void free_scene(scene* s) {
+    free_grid(s->spatial_grid);
+    free(s->spheres);
+    free(s->materials);
+}
+
+// NOTE(fede): Makes the small diffuse spheres of random_scene bounce up to
+//  max_height while the shutter is open
+void add_bouncing_motion(scene* s, float max_height) {
+    seed_random(BOUNCING_MOTION_SEED);
+    for (size_t i = 0; i < s->sphere_count; ++i) {
+        sphere *sp = &s->spheres[i];
+        if (sp->material_index == 1) {
+            sp->motion = V3(0.0, randf(0.0, max_height), 0.0);
+        }
+    }
+}
+
+// NOTE(fede): Static copy of the scene frozen at one instant of the shutter
+scene scene_at_time(scene* s, float time) {
+    scene result = *s;
+    result.spheres = (sphere *) malloc(s->sphere_count * sizeof(sphere));
+    result.materials = (material *) malloc(s->material_count * sizeof(material));
+    memcpy(result.materials, s->materials, s->material_count * sizeof(material));
+    for (size_t i = 0; i < s->sphere_count; ++i) {
+        sphere sp = s->spheres[i];
+        sp.center = sphere_center(&sp, time);
+        sp.motion = V3(0.0, 0.0, 0.0);
+        result.spheres[i] = sp;
+    }
+    result.spatial_grid = (result.accelerator == UniformGrid) ? build_grid(&result) : NULL;
+
+    return result;
+}
+
+// NOTE(fede): Compares the linear loop against the uniform grid for growing
+//  scenes. The plane extent grows with sqrt(sphere_count) so the density of
+//  spheres stays the same as the default scene. Rays start above the plane
+//  with random directions, like the bounce rays that dominate path tracing.
+//  The second table makes the small diffuse spheres bounce and gives rays
+//  random times, to check the time buckets of the grid against the linear
+//  loop.
+void benchmark_grid() {
+    int sphere_counts[] = { 100, 1000, 10000, 100000, 1000000 };
+    int ray_count = 1 << 16;
+    // NOTE(fede): Cap the work of the linear loop, it is O(rays * spheres)
+    double max_linear_tests = (double) (1 << 28);
+
+    ray *rays = (ray *) malloc(ray_count * sizeof(ray));
+    hit_information *linear_hits = (hit_information *) malloc(ray_count * sizeof(hit_information));
+
+    for (int moving = 0; moving < 2; ++moving) {
+        printf("%s\n", moving ? "Bouncing spheres, rays at random times" : "Static spheres");
+        printf("%10s %10s %10s %8s %12s %12s %9s %10s\n",
+               "spheres", "build ms", "cells", "large", "linear r/s", "grid r/s", "speedup", "mismatch");
+        for (int n = 0; n < (int) (sizeof(sphere_counts) / sizeof(sphere_counts[0])); ++n) {
+            int sphere_count = sphere_counts[n];
+            float extent = 11.0 * sqrtf(sphere_count / 100.0);
+            scene s = random_scene(sphere_count, extent);
+            if (moving) {
+                add_bouncing_motion(&s, 2.0);
+            }
+
+            for (int i = 0; i < ray_count; ++i) {
+                v3 origin = V3(randf(-extent, extent), randf(0.5, 2.0), randf(-extent, extent));
+                ray r = { origin, rand_unit_vector(), moving ? randf() : 0.0f };
+                rays[i] = r;
+            }
+
+            double build_start = get_wall_clock();
+            s.spatial_grid = build_grid(&s);
+            double build_seconds = get_wall_clock() - build_start;
+
+            int linear_ray_count = (int) min(ray_count, max(64.0, max_linear_tests / s.sphere_count));
+            double linear_start = get_wall_clock();
+            for (int i = 0; i < linear_ray_count; ++i) {
+                linear_hits[i] = hit_scene_linear(&rays[i], 0.001, FLT_MAX, &s);
+            }
+            double linear_seconds = get_wall_clock() - linear_start;
+
+            int mismatch_count = 0;
+            double grid_start = get_wall_clock();
+            for (int i = 0; i < ray_count; ++i) {
+                hit_information h = hit_scene_grid(&rays[i], 0.001, FLT_MAX, &s);
+                if (i < linear_ray_count &&
+                    (h.hit_object != linear_hits[i].hit_object ||
+                     (h.hit_object && h.object_index != linear_hits[i].object_index))) {
+                    mismatch_count++;
+                }
+            }
+            double grid_seconds = get_wall_clock() - grid_start;
+
+            double linear_rays_per_second = linear_ray_count / linear_seconds;
+            double grid_rays_per_second = ray_count / grid_seconds;
+            printf("%10d %10.2f %10d %8d %12.0f %12.0f %8.1fx %10d\n",
+                   (int) s.sphere_count,
+                   build_seconds * 1000.0,
+                   s.spatial_grid->cell_count,
+                   s.spatial_grid->large_count,
+                   linear_rays_per_second,
+                   grid_rays_per_second,
+                   grid_rays_per_second / linear_rays_per_second,
+                   mismatch_count);
+
+            free_scene(&s);
+        }
+        printf("\n");
+    }
+
+    free(linear_hits);
+    free(rays);
+}
+
+struct loaded_scene {
+    char path[256];
+    scene s;
+};
+
+// NOTE(fede): Jobs file, one job per line:
+//
+//  # scene output width height samples_per_pixel max_depth position(x y z) look_at(x y z) vfov focus_distance defocus_angle [seed]
+//  default thumb_000.ppm 160 90 32 10  13 2 3  0 0 0  20 10 0.6
+//
+//  The scene is a scene file path (see scene_file.h), "default" for the
+//  random spheres scene or "bouncing" for the same scene with its small
+//  diffuse spheres moving up while the shutter is open. Each scene is
+//  loaded once and shared by its jobs.
+int run_batch(const char* jobs_path, int thread_count, int tile_size, render_cache* cache, regression_options* regression) {
+    double start_time = get_wall_clock();
+
+    FILE *file = fopen(jobs_path, "r");
+    if (!file) {
+        perror(jobs_path);
+        return EXIT_FAILURE;
+    }
+
+    int job_capacity = 0;
+    int job_count = 0;
+    char (*job_scene_paths)[256] = NULL;
+    char (*job_output_paths)[256] = NULL;
+    render_settings *job_settings = NULL;
+    camera *job_cameras = NULL;
+
+    bool ok = true;
+    int line_number = 0;
+    char line[1024];
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char first[2] = {};
+        if (sscanf(line, " %1s", first) != 1 || first[0] == '#') {
+            continue;
+        }
+
+        if (job_count == job_capacity) {
+            job_capacity = job_capacity ? 2 * job_capacity : 64;
+            job_scene_paths = (char (*)[256]) realloc(job_scene_paths, job_capacity * 256);
+            job_output_paths = (char (*)[256]) realloc(job_output_paths, job_capacity * 256);
+            job_settings = (render_settings *) realloc(job_settings, job_capacity * sizeof(render_settings));
+            job_cameras = (camera *) realloc(job_cameras, job_capacity * sizeof(camera));
+        }
+
+        render_settings settings = {};
+        v3 position;
+        v3 look_at;
+        float vfov_degrees;
+        float focus_distance;
+        float defocus_angle_degrees;
+        int read = sscanf(line, "%255s %255s %d %d %d %d %f %f %f %f %f %f %f %f %f %u",
+                          job_scene_paths[job_count], job_output_paths[job_count],
+                          &settings.image_width, &settings.image_height,
+                          &settings.samples_per_pixel, &settings.max_depth,
+                          &position.x, &position.y, &position.z,
+                          &look_at.x, &look_at.y, &look_at.z,
+                          &vfov_degrees, &focus_distance, &defocus_angle_degrees,
+                          &settings.seed);
+        if ((read != 15 && read != 16) || settings.image_width < 1 || settings.image_height < 1 || settings.samples_per_pixel < 1) {
+            fprintf(stderr, "%s:%d: invalid job: %s", jobs_path, line_number, line);
+            ok = false;
+            break;
+        }
+
+        settings.tile_size = tile_size;
+        job_settings[job_count] = settings;
+        job_cameras[job_count] = Camera(
+            settings.image_width,
+            settings.image_height,
+            position,
+            look_at,
+            V3(0.0, 1.0, 0.0),
+            vfov_degrees,
+            focus_distance,
+            defocus_angle_degrees
+        );
+        job_count++;
+    }
+    fclose(file);
+
+    loaded_scene *scenes = (loaded_scene *) calloc(job_count + 1, sizeof(loaded_scene));
+    int scene_count = 0;
+    render_job *jobs = new render_job[job_count + 1]();
+    for (int j = 0; ok && j < job_count; ++j) {
+        int scene_index = 0;
+        while (scene_index < scene_count && strcmp(scenes[scene_index].path, job_scene_paths[j]) != 0) {
+            scene_index++;
+        }
+
+        if (scene_index == scene_count) {
+            loaded_scene *loaded = &scenes[scene_count];
+            strcpy(loaded->path, job_scene_paths[j]);
+            if (strcmp(loaded->path, "default") == 0 || strcmp(loaded->path, "bouncing") == 0) {
+                loaded->s = random_scene(100, 11.0);
+                if (strcmp(loaded->path, "bouncing") == 0) {
+                    add_bouncing_motion(&loaded->s, 0.5);
+                }
+                loaded->s.accelerator = UniformGrid;
+                loaded->s.spatial_grid = build_grid(&loaded->s);
+            } else if (!load_scene_file(loaded->path, &loaded->s)) {
+                ok = false;
+                break;
+            }
+            scene_count++;
+        }
+
+        jobs[j].output_path = job_output_paths[j];
+        jobs[j].scene_object = &scenes[scene_index].s;
+        jobs[j].c = job_cameras[j];
+        jobs[j].settings = job_settings[j];
+    }
+
+    int failed_count = 0;
+    if (ok) {
+        double render_start_time = get_wall_clock();
+        printf("Loaded %d jobs and %d scenes in %.2lf seconds, rendering with %d threads\n\n",
+               job_count, scene_count, render_start_time - start_time, thread_count);
+
+        render_jobs(jobs, job_count, thread_count, cache);
+
+        double end_time = get_wall_clock();
+        for (int j = 0; j < job_count; ++j) {
+            render_job *job = &jobs[j];
+            if (job->failed) {
+                failed_count++;
+            }
+            // NOTE(fede): Latency counts from the start of rendering, so it
+            //  includes the time the job waited behind earlier jobs
+            printf("%-32s %5dx%-5d %5d spp  latency %8.1f ms  render %8.1f ms%s\n",
+                   job->output_path,
+                   job->settings.image_width, job->settings.image_height,
+                   job->settings.samples_per_pixel,
+                   (job->end_time - render_start_time) * 1000.0,
+                   (job->end_time - job->start_time) * 1000.0,
+                   job->failed ? "  FAILED" : "");
+        }
+
+        double render_seconds = end_time - render_start_time;
+        printf("\nRendered %d images in %.2lf seconds (%.0lf images/hour)\n",
+               job_count, render_seconds, job_count / render_seconds * 3600.0);
+        printf("Total elapsed time is: %.2lf seconds\n\n", end_time - start_time);
+        if (cache) {
+            print_cache_stats(cache);
+        }
+        if (regression && !run_regression(regression, jobs, job_count)) {
+            ok = false;
+        }
+    }
+
+    free_render_jobs(jobs, job_count);
+    delete[] jobs;
+    for (int i = 0; i < scene_count; ++i) {
+        free_scene(&scenes[i].s);
+    }
+    free(scenes);
+    free(job_scene_paths);
+    free(job_output_paths);
+    free(job_settings);
+    free(job_cameras);
 
-    FILE *file = fopen("image_output.ppm", "wb");
+    return (ok && failed_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    if (file) {
-        fprintf(file, "P6\n%d %d\n255\n", image_width, image_height);
+double accumulation_rmse(float* accumulation, int samples_per_pixel, float* reference, size_t value_count) {
+    double squared_error_sum = 0.0;
+    for (size_t i = 0; i < value_count; ++i) {
+        double error = accumulation[i] / samples_per_pixel - reference[i];
+        squared_error_sum += error * error;
+    }
+    return sqrt(squared_error_sum / value_count);
+}
+
+// NOTE(fede): Renders the scene with time sampled rays, returns the RMSE
+//  against reference and the wall time in seconds
+double render_time_sampled(scene* s, camera* c, render_settings settings, float* reference, double* seconds) {
+    render_job *job = new render_job();
+    job->scene_object = s;
+    job->c = *c;
+    job->settings = settings;
+
+    double start = get_wall_clock();
+    render_jobs(job, 1, 1, NULL);
+    *seconds = get_wall_clock() - start;
+    size_t value_count = (size_t) settings.image_width * settings.image_height * 3;
+    double rmse = accumulation_rmse(job->accumulation, settings.samples_per_pixel, reference, value_count);
+
+    free_render_jobs(job, 1);
+    delete job;
+    return rmse;
+}
 
-        int buffer_size = image_height * image_width * 3;
-        char *buffer = (char *) malloc(buffer_size);
-        if (buffer == NULL) {
-            perror("malloc");
-            fclose(file);
-            exit(EXIT_FAILURE);
+// NOTE(fede): Accumulates frame_count renders of the scene frozen at evenly
+//  spaced instants, each one a full render with its own scene copy and
+//  grid. settings.samples_per_pixel is the total over every frame, spread
+//  as evenly as it goes, so it must be at least frame_count. Frames are
+//  averaged with equal weight whatever their sample count.
+double render_sub_frames(scene* s, camera* c, render_settings settings, int frame_count, float* reference, double* seconds) {
+    double start = get_wall_clock();
+    scene *frames = (scene *) malloc(frame_count * sizeof(scene));
+    render_job *jobs = new render_job[frame_count]();
+    for (int f = 0; f < frame_count; ++f) {
+        frames[f] = scene_at_time(s, (f + 0.5f) / frame_count);
+        jobs[f].scene_object = &frames[f];
+        jobs[f].c = *c;
+        jobs[f].settings = settings;
+        jobs[f].settings.samples_per_pixel = settings.samples_per_pixel / frame_count +
+                                             (f < settings.samples_per_pixel % frame_count ? 1 : 0);
+        jobs[f].settings.seed = settings.seed + f;
+    }
+    render_jobs(jobs, frame_count, 1, NULL);
+
+    size_t value_count = (size_t) settings.image_width * settings.image_height * 3;
+    float *sum = (float *) calloc(value_count, sizeof(float));
+    for (int f = 0; f < frame_count; ++f) {
+        float frame_scale = 1.0f / jobs[f].settings.samples_per_pixel;
+        for (size_t i = 0; i < value_count; ++i) {
+            sum[i] += jobs[f].accumulation[i] * frame_scale;
         }
+    }
+    *seconds = get_wall_clock() - start;
+    double rmse = accumulation_rmse(sum, frame_count, reference, value_count);
+
+    free(sum);
+    free_render_jobs(jobs, frame_count);
+    delete[] jobs;
+    for (int f = 0; f < frame_count; ++f) {
+        free_scene(&frames[f]);
+    }
+    free(frames);
+    return rmse;
+}
 
-        time_t time_before_iterating_over_pixels = time(0);
-        double diff_time = difftime(time_before_iterating_over_pixels, start_time);
-        printf("Elapsed time before iterating over pixels is: %.2lf seconds\n\n", diff_time);
-
-        for (int j = 0; j < image_height; ++j) {
-            for (int i = 0; i < image_width; ++i) {
-                v3 color = V3(0.0, 0.0, 0.0);
-                // NOTE(fede): Sampling for antialiasing
-                for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                    ray r = get_ray(&c, i, j);
-                    color += ray_color(&r, max_depth, 0, FLT_MAX, &s);
+// NOTE(fede): Motion blur with time sampled rays against accumulating
+//  sub-frame renders, at equal quality. For each target RMSE (against a
+//  high sample count time sampled reference with a different seed) every
+//  method raises its total samples per pixel, split across its frames,
+//  until it gets there, and the time of that render is reported. With few
+//  sub-frames the stepping between frozen instants is an error more samples
+//  cannot remove, so the spheres bounce 2 units, several times their
+//  radius, to make it show. K sub-frames need at least K samples, when that
+//  already lands well under the target the method is marked as overshoot
+//  and not compared, its time would mostly measure the extra samples.
+//  Renders are single threaded so timings are comparable.
+void benchmark_motion() {
+    int max_samples = 512;
+    int sub_frame_counts[] = { 4, 16, 64 };
+    float target_rmses[] = { 0.04, 0.02, 0.01 };
+    // NOTE(fede): RMSE falls with the square root of the samples, so landing
+    //  under 0.7 of the target took about twice the samples needed
+    float overshoot_factor = 0.7;
+
+    render_settings settings = {};
+    settings.image_width = 160;
+    settings.image_height = 90;
+    settings.max_depth = 10;
+    settings.samples_per_pixel = 2048;
+    settings.seed = 0x5eed;
+
+    camera c = Camera(settings.image_width, settings.image_height, V3(13.0, 2.0, 3.0), V3(0.0, 0.0, 0.0), V3(0.0, 1.0, 0.0), 20.0, 10.0, 0.6);
+    scene s = random_scene(100, 11.0);
+    add_bouncing_motion(&s, 2.0);
+    s.accelerator = UniformGrid;
+    s.spatial_grid = build_grid(&s);
+
+    render_job *reference = new render_job();
+    reference->scene_object = &s;
+    reference->c = c;
+    reference->settings = settings;
+    printf("Rendering %dx%d reference with %d samples per pixel...\n\n",
+           settings.image_width, settings.image_height, settings.samples_per_pixel);
+    render_jobs(reference, 1, (int) std::thread::hardware_concurrency(), NULL);
+    size_t value_count = (size_t) settings.image_width * settings.image_height * 3;
+    for (size_t i = 0; i < value_count; ++i) {
+        reference->accumulation[i] /= settings.samples_per_pixel;
+    }
+    settings.seed = 1;
+
+    int target_count = (int) (sizeof(target_rmses) / sizeof(target_rmses[0]));
+    int method_count = 1 + (int) (sizeof(sub_frame_counts) / sizeof(sub_frame_counts[0]));
+    printf("%-12s %7s %10s %10s %10s %9s %9s\n", "target rmse", "frames", "spp/frame", "total spp", "seconds", "rmse", "time");
+    for (int t = 0; t < target_count; ++t) {
+        double time_sampled_seconds = 0.0;
+        for (int m = 0; m < method_count; ++m) {
+            // NOTE(fede): Method 0 is time sampled, one frame
+            int frame_count = (m == 0) ? 1 : sub_frame_counts[m - 1];
+            bool reached = false;
+            double seconds = 0.0;
+            double rmse = 0.0;
+            // NOTE(fede): Steps of about 1.5x from the fewest samples the method
+            //  can take, doubling is too coarse to compare methods
+            int samples = frame_count;
+            for (; samples <= max_samples; samples += max(1, samples / 2)) {
+                render_settings frame_settings = settings;
+                frame_settings.samples_per_pixel = samples;
+                if (m == 0) {
+                    rmse = render_time_sampled(&s, &c, frame_settings, reference->accumulation, &seconds);
+                } else {
+                    rmse = render_sub_frames(&s, &c, frame_settings, frame_count, reference->accumulation, &seconds);
                 }
+                if (rmse <= target_rmses[t]) {
+                    reached = true;
+                    break;
+                }
+            }
 
-                color *= pixel_samples_scale;
-                float r = linear_to_gamma(color.r);
-                float g = linear_to_gamma(color.g);
-                float b = linear_to_gamma(color.b);
-                
-                int index = (j * image_width + i) * 3;
-                buffer[index + 0] = (int) (r * 255.0f);
-                buffer[index + 1] = (int) (g * 255.0f);
-                buffer[index + 2] = (int) (b * 255.0f);
+            if (!reached) {
+                printf("%-12.3f %7d %10s %10s %10s %9.5f %9s\n", target_rmses[t], frame_count,
+                       "-", "-", "-", rmse, "not met");
+                continue;
+            }
+            float samples_per_frame = (float) samples / frame_count;
+            if (samples == frame_count && frame_count > 1 && rmse < overshoot_factor * target_rmses[t]) {
+                printf("%-12.3f %7d %10.1f %10d %10.3f %9.5f %9s\n", target_rmses[t], frame_count, samples_per_frame,
+                       samples, seconds, rmse, "overshoot");
+                continue;
+            }
+            if (m == 0) {
+                time_sampled_seconds = seconds;
+            }
+            if (time_sampled_seconds > 0.0) {
+                printf("%-12.3f %7d %10.1f %10d %10.3f %9.5f %8.2fx\n", target_rmses[t], frame_count, samples_per_frame,
+                       samples, seconds, rmse, seconds / time_sampled_seconds);
+            } else {
+                printf("%-12.3f %7d %10.1f %10d %10.3f %9.5f %9s\n", target_rmses[t], frame_count, samples_per_frame,
+                       samples, seconds, rmse, "-");
             }
         }
+        printf("\n");
+    }
 
-        time_t time_before_writing_data = time(0);
-        diff_time = difftime(time_before_writing_data, start_time);
-        printf("Elapsed time before writing data is: %.2lf seconds\n\n", diff_time);
-        size_t pixel_count = image_width * image_height;
-        fwrite(buffer, 3, pixel_count, file);
+    free_render_jobs(reference, 1);
+    delete reference;
+    free_scene(&s);
+}
 
-        fclose(file);
+int main(int argc, char** argv) {
+    const char *batch_path = NULL;
+    const char *cache_directory = NULL;
+    double cache_megabytes = 1024.0;
+    int thread_count = (int) std::thread::hardware_concurrency();
+    int tile_size = RENDER_TILE_SIZE;
+    bool run_benchmark_motion = false;
+    regression_options regression = {};
+    regression.tile_size = REGRESSION_TILE_SIZE;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--benchmark-grid") == 0) {
+            benchmark_grid();
+            return 0;
+        } else if (strcmp(argv[i], "--benchmark-motion") == 0) {
+            run_benchmark_motion = true;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_directory = argv[++i];
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            cache_megabytes = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc) {
+            tile_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            regression.golden_directory = argv[++i];
+        } else if (strcmp(argv[i], "--update-golden") == 0) {
+            regression.update = true;
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            regression.tolerance = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--compare-tile") == 0 && i + 1 < argc) {
+            regression.tile_size = atoi(argv[++i]);
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--threads N] [--tile-size N] [--cache DIR] [--cache-size MB]\n"
+                    "          [--batch jobs.txt [--golden DIR [--update-golden] [--tolerance N] [--compare-tile N]]]\n"
+                    "          [--benchmark-grid] [--benchmark-motion]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    thread_count = thread_count < 1 ? 1 : thread_count;
+    if (run_benchmark_motion) {
+        benchmark_motion();
+        return 0;
+    }
+    tile_size = tile_size < 1 ? RENDER_TILE_SIZE : tile_size;
+    regression.tile_size = regression.tile_size < 1 ? REGRESSION_TILE_SIZE : regression.tile_size;
+    if (regression.golden_directory && !batch_path) {
+        fprintf(stderr, "--golden needs a --batch jobs file\n");
+        return EXIT_FAILURE;
+    }
+    if (regression.golden_directory && cache_directory) {
+        // NOTE(fede): Cached images are not fresh renders, checking them says nothing
+        fprintf(stderr, "--golden cannot be used with --cache\n");
+        return EXIT_FAILURE;
+    }
 
-        free(buffer);
+    render_cache cache_storage;
+    render_cache *cache = NULL;
+    if (cache_directory) {
+        if (!open_render_cache(&cache_storage, cache_directory, (uint64_t) (cache_megabytes * 1024.0 * 1024.0))) {
+            return EXIT_FAILURE;
+        }
+        cache = &cache_storage;
     }
 
-    time_t end_time = time(0);
-    double diff_time = difftime(end_time, start_time);
-    printf("Total elapsed time is: %.2lf seconds\n\n", diff_time);
-    
-    return 0;
-}
\ No newline at end of file
+    if (batch_path) {
+        return run_batch(batch_path, thread_count, tile_size, cache,
+                         regression.golden_directory ? &regression : NULL);
+    }
+
+    double start_time = get_wall_clock();
+    float aspect_ratio = 16.0 / 9.0;
+    int image_width = 1200;
+    int image_height = (int) image_width / aspect_ratio;
+    image_height = image_height < 1 ? 1 : image_height;
+
+    v3 camera_position        = V3(13.0, 2.0, 3.0);
+    v3 camera_look_at         = V3(0.0, 0.0, 0.0);
+    v3 camera_vup             = V3(0.0, 1.0, 0.0);
+    float camera_vfov_degrees = 20.0;
+    float focus_distance = 10.0;
+    float defocus_angle_degrees = 0.6;
+    camera c = Camera(
+        image_width,
+        image_height,
+        camera_position,
+        camera_look_at,
+        camera_vup,
+        camera_vfov_degrees,
+        focus_distance,
+        defocus_angle_degrees
+    );
+
+    scene s = random_scene(100, 11.0);
+    s.accelerator = UniformGrid;
+    s.spatial_grid = build_grid(&s);
+
+    render_job *job = new render_job();
+    job->output_path = "image_output.ppm";
+    job->scene_object = &s;
+    job->c = c;
+    job->settings.image_width = image_width;
+    job->settings.image_height = image_height;
+    job->settings.samples_per_pixel = 100;
+    job->settings.max_depth = 50;
+    job->settings.tile_size = tile_size;
+
+    printf("Elapsed time before iterating over pixels is: %.2lf seconds\n\n", get_wall_clock() - start_time);
+    render_jobs(job, 1, thread_count, cache);
+
+    printf("Total elapsed time is: %.2lf seconds\n\n", get_wall_clock() - start_time);
+    if (cache) {
+        print_cache_stats(cache);
+    }
+    bool failed = job->failed;
+    free_render_jobs(job, 1);
+    delete job;
+    free_scene(&s);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
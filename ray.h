@@ -6,6 +6,7 @@
 struct ray {
     v3 origin;
     v3 direction;
+    float time;     // NOTE(fede): Instant inside the shutter interval [0, 1) the ray samples
 };
 
 v3 ray_at(ray* r, float t) {
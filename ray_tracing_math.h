@@ -2,6 +2,7 @@
 #define RAY_TRACING_MATH
 
 #include <cstdlib>
+#include <stdint.h>
 #include "math.h"
 
 inline float degrees_to_radians(float degrees) {
@@ -157,8 +158,52 @@ inline v3 clamp01(v3 a) {
     return result;
 }
 
+// NOTE(fede): xorshift64* generator with one state per thread, std::rand
+//  shares a single locked state between every render thread. 64 bits of
+//  state keep the streams of every (pixel, sample) of an image apart.
+static thread_local uint64_t random_state = 0x9e3779b97f4a7c15ull;
+
+inline uint64_t hash_u64(uint64_t x) {
+    // NOTE(fede): splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+// NOTE(fede): Order matters, hash_combine(a, b) != hash_combine(b, a)
+inline uint64_t hash_combine(uint64_t a, uint64_t b) {
+    return hash_u64(a ^ (hash_u64(b) + 0x9e3779b97f4a7c15ull + (a << 6) + (a >> 2)));
+}
+
+inline void seed_random(uint64_t seed) {
+    random_state = hash_u64(seed);
+    if (random_state == 0) {
+        random_state = 0x9e3779b97f4a7c15ull;
+    }
+}
+
 inline float randf() {
-    return std::rand() / (RAND_MAX + 1.0);
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    // NOTE(fede): Top 24 bits so the result is in [0, 1) as a float
+    return ((random_state * 0x2545f4914f6cdd1dull) >> 40) * (1.0f / 16777216.0f);
+}
+
+// NOTE(fede): Van der Corput sequence, n with its bits reversed behind the
+//  binary point. Any 2^k consecutive values fall one in each of 2^k equal
+//  strata of [0, 1), unlike independent random numbers.
+inline float radical_inverse_base2(uint32_t n) {
+    n = (n << 16) | (n >> 16);
+    n = ((n & 0x00ff00ffu) << 8) | ((n & 0xff00ff00u) >> 8);
+    n = ((n & 0x0f0f0f0fu) << 4) | ((n & 0xf0f0f0f0u) >> 4);
+    n = ((n & 0x33333333u) << 2) | ((n & 0xccccccccu) >> 2);
+    n = ((n & 0x55555555u) << 1) | ((n & 0xaaaaaaaau) >> 1);
+    // NOTE(fede): Top 24 bits so the result is in [0, 1) as a float
+    return (n >> 8) * (1.0f / 16777216.0f);
 }
 
 inline float randf(float min, float max) {
@@ -0,0 +1,250 @@
+#ifndef RAY_TRACING_REGRESSION
+#define RAY_TRACING_REGRESSION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "render.h"
+
+// NOTE(fede): Golden image regression checks. Renders are deterministic, so
+//  a change that should not affect the image (threads, tiles, accelerators,
+//  scheduling) must match the golden images tile by tile. The golden
+//  directory holds one image per job (named after the job output file) and
+//  timings.txt with the render time of each job when the goldens were made.
+//  Render times are the CPU time spent in the tiles of the job: jobs share
+//  one pool of threads, so the wall time from the first tile to the last
+//  one depends on what the other threads were doing and is noise as soon
+//  as there is more than one thread.
+//  Renders served from the render cache would compare the cache against
+//  itself, so main refuses --golden together with --cache.
+
+#define REGRESSION_TILE_SIZE 16
+
+struct regression_options {
+    const char *golden_directory;
+    bool update;            // NOTE(fede): Write the golden images instead of checking them
+    int tile_size;
+    int tolerance;          // NOTE(fede): Max per channel difference allowed in a tile, 0..255
+};
+
+struct golden_timing {
+    char name[256];
+    double render_ms;
+};
+
+inline double render_cpu_ms(render_job* job) {
+    return job->render_cpu_ns * 1e-6;
+}
+
+bool read_ppm(const char* path, int* image_width, int* image_height, unsigned char** pixels) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    int max_value = 0;
+    bool ok = fscanf(file, "P6 %d %d %d", image_width, image_height, &max_value) == 3 &&
+              max_value == 255 && *image_width > 0 && *image_height > 0 &&
+              fgetc(file) != EOF;
+    if (ok) {
+        size_t pixel_count = (size_t) *image_width * *image_height;
+        *pixels = (unsigned char *) malloc(pixel_count * 3);
+        ok = fread(*pixels, 3, pixel_count, file) == pixel_count;
+        if (!ok) {
+            free(*pixels);
+            *pixels = NULL;
+        }
+    }
+    fclose(file);
+
+    return ok;
+}
+
+inline const char *file_name(const char* path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+int read_golden_timings(const char* golden_directory, golden_timing** timings) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/timings.txt", golden_directory);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        *timings = NULL;
+        return 0;
+    }
+
+    int timing_capacity = 64;
+    int timing_count = 0;
+    *timings = (golden_timing *) malloc(timing_capacity * sizeof(golden_timing));
+    golden_timing timing;
+    while (fscanf(file, "%255s %lf", timing.name, &timing.render_ms) == 2) {
+        if (timing_count == timing_capacity) {
+            timing_capacity *= 2;
+            *timings = (golden_timing *) realloc(*timings, timing_capacity * sizeof(golden_timing));
+        }
+        (*timings)[timing_count++] = timing;
+    }
+    fclose(file);
+
+    return timing_count;
+}
+
+bool update_golden(regression_options* options, render_job* jobs, int job_count) {
+    mkdir(options->golden_directory, 0755);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/timings.txt", options->golden_directory);
+    FILE *timings = fopen(path, "w");
+    if (!timings) {
+        perror(path);
+        return false;
+    }
+
+    bool ok = true;
+    for (int j = 0; j < job_count; ++j) {
+        render_job *job = &jobs[j];
+        snprintf(path, sizeof(path), "%s/%s", options->golden_directory, file_name(job->output_path));
+        if (job->failed || !copy_file(job->output_path, path)) {
+            fprintf(stderr, "could not store golden image %s\n", path);
+            ok = false;
+            continue;
+        }
+        fprintf(timings, "%s %.3lf\n", file_name(job->output_path), render_cpu_ms(job));
+    }
+    fclose(timings);
+
+    printf("Stored %d golden images in %s\n\n", job_count, options->golden_directory);
+    return ok;
+}
+
+// NOTE(fede): Compares one job against its golden image tile by tile.
+//  Returns the number of tiles over the tolerance, -1 if images are missing.
+int compare_with_golden(regression_options* options, render_job* job, double golden_ms) {
+    char golden_path[512];
+    snprintf(golden_path, sizeof(golden_path), "%s/%s", options->golden_directory, file_name(job->output_path));
+
+    int golden_width, golden_height, width, height;
+    unsigned char *golden = NULL;
+    unsigned char *pixels = NULL;
+    if (!read_ppm(golden_path, &golden_width, &golden_height, &golden)) {
+        printf("%-32s missing golden image %s\n", job->output_path, golden_path);
+        return -1;
+    }
+    if (!read_ppm(job->output_path, &width, &height, &pixels) || width != golden_width || height != golden_height) {
+        printf("%-32s cannot compare with %s (%dx%d)\n", job->output_path, golden_path, golden_width, golden_height);
+        free(golden);
+        free(pixels);
+        return -1;
+    }
+
+    int tile_size = options->tile_size;
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    int failed_tiles = 0;
+    int max_error = 0;
+    int worst_tile_x = 0;
+    int worst_tile_y = 0;
+    double worst_tile_mean_error = 0.0;
+    double squared_error_sum = 0.0;
+    for (int tile_y = 0; tile_y < tiles_y; ++tile_y) {
+        for (int tile_x = 0; tile_x < tiles_x; ++tile_x) {
+            int tile_max_error = 0;
+            double tile_error_sum = 0.0;
+            int tile_value_count = 0;
+            for (int j = tile_y * tile_size; j < height && j < (tile_y + 1) * tile_size; ++j) {
+                for (int i = tile_x * tile_size; i < width && i < (tile_x + 1) * tile_size; ++i) {
+                    for (int channel = 0; channel < 3; ++channel) {
+                        int index = (j * width + i) * 3 + channel;
+                        int error = abs(pixels[index] - golden[index]);
+                        tile_max_error = error > tile_max_error ? error : tile_max_error;
+                        tile_error_sum += error;
+                        squared_error_sum += (double) error * error;
+                        tile_value_count++;
+                    }
+                }
+            }
+
+            double tile_mean_error = tile_error_sum / tile_value_count;
+            if (tile_max_error > options->tolerance) {
+                failed_tiles++;
+            }
+            if (tile_max_error > max_error || (tile_max_error == max_error && tile_mean_error > worst_tile_mean_error)) {
+                max_error = tile_max_error;
+                worst_tile_mean_error = tile_mean_error;
+                worst_tile_x = tile_x;
+                worst_tile_y = tile_y;
+            }
+        }
+    }
+
+    double rmse = sqrt(squared_error_sum / ((double) width * height * 3));
+    double render_ms = render_cpu_ms(job);
+    printf("%-32s %s  tiles failed %4d/%-4d  rmse %7.3f  max %3d (tile %d,%d mean %.2f)",
+           job->output_path,
+           failed_tiles ? "FAIL" : "ok  ",
+           failed_tiles, tiles_x * tiles_y,
+           rmse, max_error, worst_tile_x, worst_tile_y, worst_tile_mean_error);
+    if (golden_ms > 0.0) {
+        printf("  cpu %8.1f ms vs %8.1f ms (%+.1f%%)\n", render_ms, golden_ms, (render_ms / golden_ms - 1.0) * 100.0);
+    } else {
+        printf("  cpu %8.1f ms\n", render_ms);
+    }
+
+    free(golden);
+    free(pixels);
+
+    return failed_tiles;
+}
+
+// NOTE(fede): Returns true when every job matches its golden image
+bool run_regression(regression_options* options, render_job* jobs, int job_count) {
+    if (options->update) {
+        return update_golden(options, jobs, job_count);
+    }
+
+    golden_timing *timings = NULL;
+    int timing_count = read_golden_timings(options->golden_directory, &timings);
+
+    printf("Regression against %s, %dx%d tiles, tolerance %d\n\n",
+           options->golden_directory, options->tile_size, options->tile_size, options->tolerance);
+    int failed_jobs = 0;
+    // NOTE(fede): The total is the number to watch, a single job is short
+    //  enough for its time to move a few percent between runs. Totals only
+    //  cover jobs with a golden timing, so a batch with a different set of
+    //  jobs still compares like with like
+    double render_total_ms = 0.0;
+    double golden_total_ms = 0.0;
+    for (int j = 0; j < job_count; ++j) {
+        double golden_ms = 0.0;
+        for (int t = 0; t < timing_count; ++t) {
+            if (strcmp(timings[t].name, file_name(jobs[j].output_path)) == 0) {
+                golden_ms = timings[t].render_ms;
+            }
+        }
+
+        if (jobs[j].failed || compare_with_golden(options, &jobs[j], golden_ms) != 0) {
+            failed_jobs++;
+        }
+        if (golden_ms > 0.0) {
+            render_total_ms += render_cpu_ms(&jobs[j]);
+            golden_total_ms += golden_ms;
+        }
+    }
+
+    printf("\n%d of %d jobs match the golden images", job_count - failed_jobs, job_count);
+    if (golden_total_ms > 0.0) {
+        printf(", render cpu time of timed jobs %.1f ms vs %.1f ms (%+.1f%%)",
+               render_total_ms, golden_total_ms, (render_total_ms / golden_total_ms - 1.0) * 100.0);
+    }
+    printf("\n\n");
+    free(timings);
+
+    return failed_jobs == 0;
+}
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef RAY_TRACING_RENDER
+#define RAY_TRACING_RENDER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+
+#include "cache.h"
+#include "camera.h"
+#include "grid.h"
+#include "hit.h"
+#include "ray_tracing_math.h"
+#include "ray.h"
+#include "scene.h"
+
+#define RENDER_TILE_SIZE 32
+
+inline double get_wall_clock() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// NOTE(fede): CPU time of the calling thread, unlike the wall clock it does
+//  not count the time the thread spent waiting for a core
+inline double get_thread_cpu_clock() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+hit_information hit_scene(ray* r, float t_min, float t_max, scene* s) {
+    switch (s->accelerator)
+    {
+    case UniformGrid: {
+        return hit_scene_grid(r, t_min, t_max, s);
+    }
+
+    default:
+        return hit_scene_linear(r, t_min, t_max, s);
+    }
+}
+
+v3 ray_color(ray* r, int max_depth, float t_min, float t_max, scene* s) {
+    if (max_depth <= 0) {
+        return V3(0.0, 0.0, 0.0);
+    }
+
+    hit_information closest = hit_scene(r, t_min, t_max, s);
+
+    if (!closest.hit_object) {
+        // NOTE(fede): If no objects hit by ray just render
+        //  the _blue_sky_ background for this ray
+        v3 unit_direction = normalize(r->direction);
+        v3 white_color = V3(1.0, 1.0, 1.0);
+        v3 blue_sky_color = V3(0.5, 0.7, 1.0);
+        float t = 0.5 * (unit_direction.y + 1.0);
+
+        return lerp(white_color, t, blue_sky_color);
+    }
+
+    material mat = scatter(r, s, &closest);
+    return hadamard(mat.attenuation, ray_color(&mat.scattered, max_depth - 1, 0.001, FLT_MAX, s));
+}
+
+inline float linear_to_gamma(float linear_component) {
+    if (linear_component > 0) {
+        return sqrtf(linear_component);
+    }
+
+    return 0;
+}
+
+struct render_settings {
+    int image_width;
+    int image_height;
+    int samples_per_pixel;
+    int max_depth;
+    uint32_t seed;
+    int tile_size;          // NOTE(fede): 0 means RENDER_TILE_SIZE, it never changes the image
+};
+
+struct render_job {
+    const char *output_path;
+    scene *scene_object;
+    camera c;
+    render_settings settings;
+    unsigned char *pixels;
+    float *accumulation;    // NOTE(fede): Sum of every sample taken so far, linear color
+    int sample_start;       // NOTE(fede): Samples already in accumulation (from the cache)
+    bool cached;            // NOTE(fede): Finished image came from the cache
+    uint64_t cache_key;
+    int tile_count;
+    std::atomic<int> tiles_remaining;
+    double start_time;      // NOTE(fede): When the first tile of the job was picked up
+    double end_time;        // NOTE(fede): When the image was written
+    std::atomic<int64_t> render_cpu_ns; // NOTE(fede): CPU time spent in the tiles of the job, summed over threads
+    bool failed;
+};
+
+struct render_work {
+    int job_index;
+    int tile_index;
+};
+
+struct render_queue {
+    render_job *jobs;
+    render_work *work;
+    int work_count;
+    std::atomic<int> next_work;
+};
+
+inline int tile_size(render_settings* settings) {
+    return settings->tile_size > 0 ? settings->tile_size : RENDER_TILE_SIZE;
+}
+
+inline int tiles_per_row(render_settings* settings) {
+    return (settings->image_width + tile_size(settings) - 1) / tile_size(settings);
+}
+
+inline int tile_count(render_settings* settings) {
+    int tiles_per_column = (settings->image_height + tile_size(settings) - 1) / tile_size(settings);
+    return tiles_per_row(settings) * tiles_per_column;
+}
+
+bool write_ppm(const char* path, int image_width, int image_height, unsigned char* pixels) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", image_width, image_height);
+    size_t pixel_count = image_width * image_height;
+    bool written = fwrite(pixels, 3, pixel_count, file) == pixel_count;
+    fclose(file);
+
+    return written;
+}
+
+// NOTE(fede): Shutter instant of a pixel sample. The samples of a pixel walk
+//  the Van der Corput sequence, so any 2^k consecutive samples cover the
+//  shutter evenly instead of clumping like independent times. Each pixel
+//  shifts the sequence by its own offset (wrapping around 1) so neighbouring
+//  pixels do not sample the same instants, which would show as banding.
+//  Both terms are multiples of 2^-24, so the wrap is exact.
+inline float shutter_time(float pixel_offset, int sample) {
+    float time = radical_inverse_base2((uint32_t) sample) + pixel_offset;
+    return time >= 1.0f ? time - 1.0f : time;
+}
+
+void render_tile(render_job* job, int tile_index) {
+    render_settings *settings = &job->settings;
+    int x_start = (tile_index % tiles_per_row(settings)) * tile_size(settings);
+    int y_start = (tile_index / tiles_per_row(settings)) * tile_size(settings);
+    int x_end = min(x_start + tile_size(settings), settings->image_width);
+    int y_end = min(y_start + tile_size(settings), settings->image_height);
+    float pixel_samples_scale = 1.0 / settings->samples_per_pixel;
+
+    // NOTE(fede): Every (seed, pixel, sample) gets its own random stream and
+    //  each pixel adds its samples in order, so the image is bit-identical
+    //  whatever the thread count, tile size or schedule. Continuing a cached
+    //  accumulation of N samples gives the same result as rendering every
+    //  sample from scratch.
+    // NOTE(fede): Shutter offsets get their own stream, UINT64_MAX is never
+    //  a sample index so it cannot match the seed of any sample
+    uint64_t shutter_seed = hash_combine(settings->seed, UINT64_MAX);
+    for (int sample = job->sample_start; sample < settings->samples_per_pixel; ++sample) {
+        // NOTE(fede): seed, sample and pixel are hashed as separate words, so
+        //  two streams only share a state on a 64 bit hash collision
+        uint64_t sample_seed = hash_combine(settings->seed, sample);
+        for (int j = y_start; j < y_end; ++j) {
+            for (int i = x_start; i < x_end; ++i) {
+                uint64_t pixel = (uint64_t) j * settings->image_width + i;
+                float pixel_offset = (hash_combine(shutter_seed, pixel) >> 40) * (1.0f / 16777216.0f);
+                seed_random(hash_combine(sample_seed, pixel));
+                // NOTE(fede): Sampling for antialiasing
+                ray r = get_ray(&job->c, i, j, shutter_time(pixel_offset, sample));
+                v3 color = ray_color(&r, settings->max_depth, 0, FLT_MAX, job->scene_object);
+
+                float *sum = &job->accumulation[(j * settings->image_width + i) * 3];
+                sum[0] += color.r;
+                sum[1] += color.g;
+                sum[2] += color.b;
+            }
+        }
+    }
+
+    for (int j = y_start; j < y_end; ++j) {
+        for (int i = x_start; i < x_end; ++i) {
+            int index = (j * settings->image_width + i) * 3;
+            float *sum = &job->accumulation[index];
+            float r = linear_to_gamma(sum[0] * pixel_samples_scale);
+            float g = linear_to_gamma(sum[1] * pixel_samples_scale);
+            float b = linear_to_gamma(sum[2] * pixel_samples_scale);
+
+            job->pixels[index + 0] = (int) (r * 255.0f);
+            job->pixels[index + 1] = (int) (g * 255.0f);
+            job->pixels[index + 2] = (int) (b * 255.0f);
+        }
+    }
+}
+
+void render_worker(render_queue* queue) {
+    while (true) {
+        int work_index = queue->next_work.fetch_add(1);
+        if (work_index >= queue->work_count) {
+            break;
+        }
+
+        render_work work = queue->work[work_index];
+        render_job *job = &queue->jobs[work.job_index];
+        if (work.tile_index == 0) {
+            job->start_time = get_wall_clock();
+        }
+
+        double tile_start = get_thread_cpu_clock();
+        render_tile(job, work.tile_index);
+        job->render_cpu_ns.fetch_add((int64_t) ((get_thread_cpu_clock() - tile_start) * 1e9));
+
+        // NOTE(fede): Whoever finishes the last tile writes the image,
+        //  jobs without output path only keep pixels and accumulation
+        if (job->tiles_remaining.fetch_sub(1) == 1) {
+            job->failed = job->output_path &&
+                          !write_ppm(job->output_path, job->settings.image_width, job->settings.image_height, job->pixels);
+            job->end_time = get_wall_clock();
+        }
+    }
+}
+
+// NOTE(fede): Renders every job with one pool of threads. The tiles of all
+//  the jobs share a single queue in job order, so small images do not leave
+//  cores idle and early jobs finish before later ones start. With a cache,
+//  jobs whose image is cached are copied instead, and jobs with a cached
+//  accumulation of fewer samples only render the missing samples.
+void render_jobs(render_job* jobs, int job_count, int thread_count, render_cache* cache) {
+    render_queue queue;
+    queue.jobs = jobs;
+    queue.work_count = 0;
+    queue.next_work = 0;
+
+    for (int j = 0; j < job_count; ++j) {
+        render_job *job = &jobs[j];
+        size_t pixel_bytes = job->settings.image_width * job->settings.image_height * 3;
+        job->pixels = (unsigned char *) malloc(pixel_bytes);
+        if (job->pixels == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        job->accumulation = (float *) calloc(pixel_bytes, sizeof(float));
+        if (job->accumulation == NULL) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        job->sample_start = 0;
+        job->cached = false;
+        job->failed = false;
+        job->render_cpu_ns = 0;
+        job->tile_count = tile_count(&job->settings);
+
+        if (cache) {
+            render_settings *settings = &job->settings;
+            job->cache_key = accumulation_key(job->scene_object, &job->c, settings->image_width, settings->image_height,
+                                              settings->max_depth, settings->seed);
+            if (cache_lookup_image(cache, image_key(job->cache_key, settings->samples_per_pixel),
+                                   settings->image_width, settings->image_height, job->output_path)) {
+                job->cached = true;
+                job->tile_count = 0;
+                job->start_time = get_wall_clock();
+                job->end_time = job->start_time;
+            } else {
+                job->sample_start = cache_lookup_accumulation(cache, job->cache_key, settings->image_width,
+                                                              settings->image_height, settings->samples_per_pixel,
+                                                              job->accumulation);
+            }
+        }
+
+        job->tiles_remaining = job->tile_count;
+        queue.work_count += job->tile_count;
+    }
+
+    queue.work = (render_work *) malloc(queue.work_count * sizeof(render_work));
+    for (int j = 0, work_index = 0; j < job_count; ++j) {
+        for (int tile = 0; tile < jobs[j].tile_count; ++tile) {
+            render_work work = { j, tile };
+            queue.work[work_index++] = work;
+        }
+    }
+
+    thread_count = thread_count < 1 ? 1 : thread_count;
+    std::thread *threads = new std::thread[thread_count - 1];
+    for (int t = 0; t < thread_count - 1; ++t) {
+        threads[t] = std::thread(render_worker, &queue);
+    }
+    // NOTE(fede): The calling thread is part of the pool too
+    render_worker(&queue);
+    for (int t = 0; t < thread_count - 1; ++t) {
+        threads[t].join();
+    }
+
+    delete[] threads;
+    free(queue.work);
+
+    if (cache) {
+        for (int j = 0; j < job_count; ++j) {
+            render_job *job = &jobs[j];
+            if (!job->cached && !job->failed) {
+                cache_store(cache, job->cache_key, job->settings.image_width, job->settings.image_height,
+                            job->settings.samples_per_pixel, job->accumulation, job->output_path);
+            }
+        }
+        cache_evict(cache);
+    }
+}
+
+void free_render_jobs(render_job* jobs, int job_count) {
+    for (int j = 0; j < job_count; ++j) {
+        free(jobs[j].pixels);
+        free(jobs[j].accumulation);
+        jobs[j].pixels = NULL;
+        jobs[j].accumulation = NULL;
+    }
+}
+
+#endif
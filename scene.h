@@ -1,7 +1,11 @@
 #ifndef RAY_TRACING_SCENE
 #define RAY_TRACING_SCENE
 
+#include <float.h>
+
+#include "hit.h"
 #include "ray_tracing_math.h"
+#include "ray.h"
 
 typedef enum {
     Lambertian,
@@ -9,6 +13,11 @@ typedef enum {
     Dielectric
 } Type;
 
+typedef enum {
+    Linear,
+    UniformGrid
+} Accelerator;
+
 struct material {
     Type type;
     v3 attenuation;
@@ -19,19 +28,99 @@ struct material {
 };
 
 struct sphere {
-    v3 center;
+    v3 center;          // NOTE(fede): Center when the shutter opens
     float radius;
     int material_index;
+    v3 motion;          // NOTE(fede): Displacement of the center while the shutter is open
 };
 
+struct grid;
+
 struct scene {
     // TODO(fede): We can generalize this instead of having a list of _spheres_
     sphere *spheres;
     size_t sphere_count;
     material *materials;
     size_t material_count;
+    Accelerator accelerator;    // NOTE(fede): Linear (default) tests every sphere, UniformGrid uses spatial_grid
+    grid *spatial_grid;
 };
 
+inline v3 sphere_center(sphere* s, float time) {
+    return s->center + time * s->motion;
+}
+
+// NOTE(fede): Bounds swept by the sphere while time goes from time_start to
+//  time_end. The centers use the same expression as sphere_center, so a ray
+//  time inside the interval never puts the sphere outside the bounds.
+inline void sphere_bounds(sphere* s, float time_start, float time_end, v3* lo, v3* hi) {
+    v3 start_center = sphere_center(s, time_start);
+    v3 end_center = sphere_center(s, time_end);
+    for (int axis = 0; axis < 3; ++axis) {
+        lo->e[axis] = min(start_center.e[axis], end_center.e[axis]) - s->radius;
+        hi->e[axis] = max(start_center.e[axis], end_center.e[axis]) + s->radius;
+    }
+}
+
+inline bool surrounds(float min, float max, float n) {
+    return min < n && n < max;
+}
+
+hit_information hit_sphere(ray* r, float t_min, float t_max, scene* scene_object, int object_index) {
+    sphere s = scene_object->spheres[object_index];
+    v3 center = sphere_center(&s, r->time);
+    v3 cq = center - r->origin;
+    float a = dot(r->direction, r->direction);
+    float b = dot(-2 * r->direction, cq);
+    float c = dot(cq, cq) - (s.radius * s.radius);
+    // NOTE(fede): Lets evaluate the quadratic equation's
+    //  discriminant to see if our ray has hit the sphere
+    float discriminant = (b * b) - 4 * a * c;
+
+    if (discriminant >= 0) {
+        float t0 = (-b - sqrtf(discriminant)) / (2 * a);
+
+        if (!surrounds(t_min, t_max, t0)) {
+            t0 = (-b + sqrtf(discriminant)) / (2 * a);
+            if (!surrounds(t_min, t_max, t0)) {
+                hit_information result = {};
+                result.hit_object = false;
+
+                return result;
+            }
+        }
+        v3 p = ray_at(r, t0);
+        v3 outward_normal = normalize(p - center);
+        bool is_front_face = dot(r->direction, outward_normal) < 0;
+
+        hit_information result = {};
+        result.t = t0;
+        result.p = p;
+        result.normal = is_front_face ? outward_normal : -outward_normal;
+        result.hit_object = true;
+        result.is_front_face = is_front_face;
+        result.object_index = object_index;
+
+        return result;
+    }
+
+    hit_information result = {V3(1, 0, 1), FLT_MAX, false};
+    return result;
+}
+
+hit_information hit_scene_linear(ray* r, float t_min, float t_max, scene* s) {
+    hit_information closest = {};
+    closest.t = FLT_MAX;
+    for (int i = 0; i < s->sphere_count; ++i) {
+        hit_information h = hit_sphere(r, t_min, t_max, s, i);
+        if (h.hit_object && h.t <= closest.t) {
+            closest = h;
+        }
+    }
+
+    return closest;
+}
+
 material lambertian_scatter(ray* in, hit_information* h, material* mat) {
     material result = {};
     v3 scattered_direction = h->normal + rand_unit_vector();
@@ -39,7 +128,7 @@ material lambertian_scatter(ray* in, hit_information* h, material* mat) {
         scattered_direction = h->normal;
     }
 
-    ray scattered = { h->p, scattered_direction };
+    ray scattered = { h->p, scattered_direction, in->time };
     result.scattered = scattered;
     result.attenuation = mat->attenuation;
     result.albedo = mat->albedo;
@@ -52,7 +141,7 @@ material metal_scatter(ray* in, hit_information* h, material* mat) {
 
     v3 reflected = reflect(in->direction, h->normal);
     reflected = normalize(reflected) + (mat->fuzz * rand_unit_vector());
-    ray scattered = { h->p, reflected };
+    ray scattered = { h->p, reflected, in->time };
     if (dot(scattered.direction, h->normal) < 0) {
         result.albedo = V3(0.0, 0.0, 0.0);
         result.attenuation = V3(0.0, 0.0, 0.0);
@@ -86,7 +175,7 @@ material dielectric_scatter(ray* in, hit_information* h, material* mat) {
         direction = refract(unit_direction, h->normal, refractive_index);
     }
 
-    ray scattered = { h->p, direction };
+    ray scattered = { h->p, direction, in->time };
     result.attenuation = V3(1.0, 1.0, 1.0);
     result.scattered = scattered;
 
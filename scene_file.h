@@ -0,0 +1,125 @@
+#ifndef RAY_TRACING_SCENE_FILE
+#define RAY_TRACING_SCENE_FILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grid.h"
+#include "ray_tracing_math.h"
+#include "scene.h"
+
+// NOTE(fede): Plain text scene description, one entry per line:
+//
+//  # comment
+//  material lambertian <r> <g> <b>
+//  material metal <r> <g> <b> <fuzz>
+//  material dielectric <refraction_index>
+//  sphere <x> <y> <z> <radius> <material_index> [<motion x> <motion y> <motion z>]
+//  accelerator linear|grid
+//
+//  Materials are indexed in the order they appear. A sphere with a motion
+//  moves its center by that displacement while the shutter is open.
+
+bool load_scene_file(const char* path, scene* result) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    scene s = {};
+    size_t sphere_capacity = 0;
+    size_t material_capacity = 0;
+    bool ok = true;
+    int line_number = 0;
+    char line[512];
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char kind[32] = {};
+        if (sscanf(line, "%31s", kind) != 1 || kind[0] == '#') {
+            continue;
+        }
+
+        if (strcmp(kind, "material") == 0) {
+            char type[32] = {};
+            material mat = {};
+            ok = sscanf(line, "%*s %31s", type) == 1;
+            if (ok && strcmp(type, "lambertian") == 0) {
+                mat.type = Lambertian;
+                ok = sscanf(line, "%*s %*s %f %f %f", &mat.albedo.r, &mat.albedo.g, &mat.albedo.b) == 3;
+                mat.attenuation = mat.albedo;
+            } else if (ok && strcmp(type, "metal") == 0) {
+                mat.type = Metal;
+                ok = sscanf(line, "%*s %*s %f %f %f %f", &mat.albedo.r, &mat.albedo.g, &mat.albedo.b, &mat.fuzz) == 4;
+                mat.attenuation = mat.albedo;
+            } else if (ok && strcmp(type, "dielectric") == 0) {
+                mat.type = Dielectric;
+                ok = sscanf(line, "%*s %*s %f", &mat.refraction_index) == 1;
+                mat.attenuation = V3(1.0, 1.0, 1.0);
+            } else {
+                ok = false;
+            }
+
+            if (ok) {
+                if (s.material_count == material_capacity) {
+                    material_capacity = material_capacity ? 2 * material_capacity : 8;
+                    s.materials = (material *) realloc(s.materials, material_capacity * sizeof(material));
+                }
+                s.materials[s.material_count++] = mat;
+            }
+        } else if (strcmp(kind, "sphere") == 0) {
+            sphere sp = {};
+            int read = sscanf(line, "%*s %f %f %f %f %d %f %f %f",
+                              &sp.center.x, &sp.center.y, &sp.center.z, &sp.radius, &sp.material_index,
+                              &sp.motion.x, &sp.motion.y, &sp.motion.z);
+            ok = read == 5 || read == 8;
+            if (ok) {
+                if (s.sphere_count == sphere_capacity) {
+                    sphere_capacity = sphere_capacity ? 2 * sphere_capacity : 64;
+                    s.spheres = (sphere *) realloc(s.spheres, sphere_capacity * sizeof(sphere));
+                }
+                s.spheres[s.sphere_count++] = sp;
+            }
+        } else if (strcmp(kind, "accelerator") == 0) {
+            char name[32] = {};
+            ok = sscanf(line, "%*s %31s", name) == 1;
+            if (ok && strcmp(name, "linear") == 0) {
+                s.accelerator = Linear;
+            } else if (ok && strcmp(name, "grid") == 0) {
+                s.accelerator = UniformGrid;
+            } else {
+                ok = false;
+            }
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "%s:%d: invalid scene entry: %s", path, line_number, line);
+        }
+    }
+    fclose(file);
+
+    for (size_t i = 0; ok && i < s.sphere_count; ++i) {
+        if (s.spheres[i].material_index < 0 || s.spheres[i].material_index >= (int) s.material_count) {
+            fprintf(stderr, "%s: sphere %d uses missing material %d\n", path, (int) i, s.spheres[i].material_index);
+            ok = false;
+        }
+    }
+
+    if (!ok) {
+        free(s.spheres);
+        free(s.materials);
+        return false;
+    }
+
+    if (s.accelerator == UniformGrid) {
+        s.spatial_grid = build_grid(&s);
+    }
+    *result = s;
+
+    return true;
+}
+
+#endif